@@ -0,0 +1,177 @@
+/*!
+ * \brief Scan benchmark for cache coloured buffer pools
+ *
+ * Allocates a set of buffers from a plain pool and from coloured pools, then
+ * repeatedly reads the first cache line of every buffer, which is the access
+ * pattern that suffers when the buffers all map to the same cache sets. Each
+ * buffer holds a pointer to the next so the reads can't overlap and every miss
+ * shows up in the time per access.
+ *
+ * The buffers' first cache lines fit in the L1 data cache, but there are more of
+ * them than there are ways in a cache set, so the scan only misses when buffers
+ * share cache sets, or when their pages share TLB sets. Each power-of-two size is
+ * run as is and less the 32 bytes the pool and malloc keep in front of a plain
+ * buffer, so that the plain pool's buffers are exactly a power of two apart.
+ * Each pool runs in its own process, so the plain pool lays its buffers out
+ * one after another on a fresh heap rather than in leftover chunks.
+ * L1 data cache read misses are counted with perf_event_open where the kernel
+ * allows it, otherwise only the time per scan is reported.
+ *
+ * Build and run from the top of the repo with:
+ *   gcc -O2 -std=c11 -Isrc/BufferPool bench/bufferpool_scan.c src/BufferPool/bufferpool.c -o bufferpool_scan
+ *   ./bufferpool_scan
+ *
+ */
+
+#define _DEFAULT_SOURCE // For syscall and clock_gettime
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "bufferpool.h"
+
+#define SCANBUFFERS 48     // Number of buffers scanned, one cache line each
+#define SCANPASSES 20000   // Number of times the buffers are scanned
+#define BUFFERHEADER 32    // Bytes the pool and malloc keep in front of each plain buffer
+
+static int openL1MissCounter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void runScan(const char* label, tBufferPool* pool, int counter)
+{
+    static void** buffers[SCANBUFFERS];
+
+    if (pool == NULL)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < SCANBUFFERS; i++)
+    {
+        buffers[i] = com_wadsweb_bufferpool.calloc(pool);
+    }
+
+    // Link the buffers into a ring, which also faults in their pages before timing starts
+    for (uint32_t i = 0; i < SCANBUFFERS; i++)
+    {
+        buffers[i][0] = buffers[(i + 1) % SCANBUFFERS];
+    }
+    void** chase = buffers[0];
+
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    double start = now();
+
+    for (uint32_t pass = 0; pass < SCANPASSES; pass++)
+    {
+        for (uint32_t i = 0; i < SCANBUFFERS; i++)
+        {
+            chase = *chase;
+        }
+    }
+
+    double elapsed = now() - start;
+    uint64_t misses = 0;
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+        {
+            misses = 0;
+        }
+    }
+
+    tBufferPoolStats stats;
+    com_wadsweb_bufferpool.getStats(pool, &stats);
+    printf("%7zu  %-10s  %10.1f", stats.bufferSize, label, elapsed * 1e9 / ((double)SCANPASSES * SCANBUFFERS));
+    if (counter >= 0)
+    {
+        printf("  %12.3f", (double)misses / ((double)SCANPASSES * SCANBUFFERS));
+    }
+    printf("%s\n", chase == NULL ? " " : "");
+
+    for (uint32_t i = 0; i < SCANBUFFERS; i++)
+    {
+        com_wadsweb_bufferpool.free((void*)buffers[i]);
+    }
+    com_wadsweb_bufferpool.purgeFreeList(pool);
+}
+
+int main(void)
+{
+    static const uint32_t colours[] = { 2, 4, 16, 64 };
+    int counter = openL1MissCounter();
+
+    // Keep every pool on normal pages. Otherwise the plain pool's heap can end up on transparent huge pages
+    // while the larger slab allocations don't, and the difference in TLB misses swamps the cache set effects
+    prctl(PR_SET_THP_DISABLE, 1, 0, 0, 0);
+
+    printf("%d buffers, %d scans of the first cache line of each\n", SCANBUFFERS, SCANPASSES);
+    printf("   size  pool        ns/access%s\n", counter >= 0 ? "  L1D misses/access" : "");
+
+    for (size_t pageMultiple = 4096; pageMultiple <= 128 * 1024; pageMultiple *= 2)
+    {
+        size_t sizes[] = { pageMultiple - BUFFERHEADER, pageMultiple };
+        for (uint32_t s = 0; s < 2; s++)
+        {
+            for (uint32_t i = 0; i <= sizeof(colours) / sizeof(colours[0]); i++)
+            {
+                // Run each pool in its own process so it starts with a fresh heap rather than
+                // reusing whatever chunks the previous pools happened to leave behind
+                fflush(stdout);
+                if (fork() == 0)
+                {
+                    if (i == 0)
+                    {
+                        runScan("create", com_wadsweb_bufferpool.create("bench_plain", sizes[s], 0, 0), counter);
+                    }
+                    else
+                    {
+                        char label[16];
+                        snprintf(label, sizeof(label), "colours %u", colours[i - 1]);
+                        runScan(label, com_wadsweb_bufferpool.createColoured("bench_coloured", sizes[s], 0, 0, colours[i - 1]), counter);
+                    }
+                    fflush(stdout);
+                    _exit(0);
+                }
+                wait(NULL);
+            }
+        }
+    }
+
+    if (counter >= 0)
+    {
+        close(counter);
+    }
+
+    return 0;
+}
@@ -8,18 +8,43 @@
  *
  */
 
+#define _DEFAULT_SOURCE // For the POSIX file and memory mapping functions
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "bufferpool.h"
 
 // Magic number to confirm this really is a buffer pool we are dealing with
 #define BUFFERPOOLMAGIC 0x5533AADD
 
+// Coloured pools carve buffers out of page aligned slabs, offsetting the first buffer
+// in each slab within the page by a multiple of the cache line size
+#define BUFFERPOOLCOLOURALIGN 4096
+#define BUFFERPOOLCOLOURSTRIDE 64
+#define BUFFERPOOLMAXCOLOURS (BUFFERPOOLCOLOURALIGN / BUFFERPOOLCOLOURSTRIDE)
+
+// Minimum number of buffers in a slab so the slab padding is spread over several buffers
+#define BUFFERPOOLSLABBUFFERS 8
+
+// Number of cache lines in a page, so the number of cache sets buffer starts can be spread over
+#define BUFFERPOOLCOLOURLINES (BUFFERPOOLCOLOURALIGN / BUFFERPOOLCOLOURSTRIDE)
+
+// Magic number to confirm a mapped region really holds a persistent buffer pool
+#define BUFFERPOOLREGIONMAGIC 0x5533AAEE
+
+// Items in a mapped region are laid out on cache line boundaries
+#define BUFFERPOOLREGIONALIGN 64
+
 typedef struct tBufferPoolImpl tBufferPoolImpl;
 
 // Header for an individual buffer
@@ -28,10 +53,40 @@ typedef struct tBufferPoolBufferItem
     uint32_t magic;                      //!< Magic number to identify a buffer pool item
     uint32_t unique;                     //!< Random number to identify a specific buffer pool
     struct tBufferPoolImpl* pBufferPool; //!< Buffer pool that owns this buffer item
-    struct tBufferPoolBufferItem* pNext; //!< Next item or NULL
+    union
+    {
+        struct tBufferPoolBufferItem* pNext; //!< Next item or NULL
+        uint64_t nextOffset;                 //!< Offset of the next item from the start of the region or 0 (persistent pools)
+    };
     // The actual buffer starts immediately after here in memory!
 } tBufferPoolBufferItem;
 
+// Header at the start of each slab of a coloured pool
+typedef struct tBufferPoolSlab
+{
+    struct tBufferPoolSlab* pNext; //!< Next slab in the pool or NULL
+    uint32_t carvedBuffers;        //!< Number of buffers handed out from this slab
+    uint32_t freeBuffers;          //!< Number of this slab's buffers on the free list (only valid while purging)
+} tBufferPoolSlab;
+
+// Items in a slab are preceded by a pointer back to their slab, so only coloured pools pay for it
+#define BUFFERPOOLSLABITEMHEADER sizeof(tBufferPoolSlab*)
+
+// Header at the start of the mapped region of a persistent pool
+// Everything in here is position independent so the region can be mapped at a different address on restart
+typedef struct
+{
+    uint32_t magic;            //!< Magic number to identify a persistent buffer pool region
+    uint32_t unique;           //!< Random number to identify a specific buffer pool (persists across restarts)
+    uint64_t bufferSize;       //!< Size of the buffers in this pool
+    uint64_t itemSize;         //!< Distance between successive items in the region
+    uint64_t firstItemOffset;  //!< Offset of the first item from the start of the region
+    uint64_t freeHeadOffset;   //!< Offset of the head of the free list from the start of the region or 0
+    uint32_t maxBuffers;       //!< Number of buffers the region has room for
+    uint32_t allocatedBuffers; //!< Number of items handed out from the region so far
+    uint32_t freeBuffers;      //!< Number of items on the free list
+} tBufferPoolRegionHeader;
+
 // Internal representation of a buffer pool
 struct tBufferPoolImpl
 {
@@ -44,9 +99,20 @@ struct tBufferPoolImpl
     uint32_t allocatedBuffers;                  //!< Total number of buffers allocated
     uint32_t freeBuffers;                       //!< Number of buffers currently free
     uint32_t maxBuffers;                        //!< Maximum allowed number of buffers (0 == unlimited)
+    uint32_t colours;                           //!< Number of cache colours to stagger buffers across (1 == no colouring)
+    uint32_t nextColour;                        //!< Colour to give the next slab allocated
+    tBufferPoolSlab* pSlabListHead;             //!< Slabs allocated for a coloured pool
+    size_t slabSize;                            //!< Size of each slab in bytes
+    size_t itemSize;                            //!< Distance between successive items in a slab
+    uint8_t* pSlabCursor;                       //!< Next unused item in the current slab
+    uint32_t slabRemaining;                     //!< Number of unused items left in the current slab
+    uint32_t buffersPerSlab;                    //!< Number of buffers that fit in a slab
     uint32_t outOfBuffers;                      //!< Count of how many times the max buffers limit has been hit
     uint32_t outOfMemory;                       //!< Count of how many out of memory errors there have been on this pool
     uint32_t totalAllocationRequests;           //!< Total number of requests for buffers
+    tBufferPoolRegionHeader* pRegion;           //!< Mapped region backing a persistent or contiguous pool or NULL if heap backed
+    size_t regionSize;                          //!< Size of the mapped region in bytes
+    int fd;                                     //!< Locked backing file of a persistent pool or -1
 };
 
 // Buffer pool list head. Used for debug and statistics
@@ -54,6 +120,73 @@ static tBufferPoolImpl* mpBufferPoolListHead = NULL;
 
 /** Private functions **/
 
+/*!
+ * \brief Get the item at the given index in the mapped region of a persistent pool
+ */
+static tBufferPoolBufferItem* bufferPoolRegionItem(tBufferPoolRegionHeader* region, uint32_t index)
+{
+    return (tBufferPoolBufferItem*)(((uint8_t*)region) + region->firstItemOffset + index * region->itemSize);
+}
+
+/*!
+ * \brief Get the offset of an item from the start of the mapped region of a persistent pool
+ */
+static uint64_t bufferPoolRegionOffset(tBufferPoolRegionHeader* region, tBufferPoolBufferItem* item)
+{
+    return ((uint8_t*)item) - ((uint8_t*)region);
+}
+
+/*!
+ * \brief Offset of the first item in a slab before colouring, chosen so the buffers are cache line aligned
+ */
+static size_t bufferPoolSlabFirstItemOffset(void)
+{
+    return ((sizeof(tBufferPoolSlab) + BUFFERPOOLSLABITEMHEADER + sizeof(tBufferPoolBufferItem) + BUFFERPOOLCOLOURSTRIDE - 1) & ~(size_t)(BUFFERPOOLCOLOURSTRIDE - 1)) - sizeof(tBufferPoolBufferItem);
+}
+
+/*!
+ * \brief Get the slab a coloured pool's item was carved from
+ */
+static tBufferPoolSlab** bufferPoolSlabOfItem(tBufferPoolBufferItem* item)
+{
+    return (tBufferPoolSlab**)(((uint8_t*)item) - BUFFERPOOLSLABITEMHEADER);
+}
+
+/*!
+ * \brief Carve the next item out of the current slab of a coloured pool, starting a new slab if needed
+ */
+static tBufferPoolBufferItem* bufferPoolSlabCarveItem(tBufferPoolImpl* pool)
+{
+    if (pool->slabRemaining == 0)
+    {
+        tBufferPoolSlab* slab = aligned_alloc(BUFFERPOOLCOLOURALIGN, pool->slabSize);
+        if (slab == NULL)
+        {
+            return NULL;
+        }
+
+        slab->carvedBuffers = 0;
+        slab->pNext = pool->pSlabListHead;
+        pool->pSlabListHead = slab;
+
+        // Each colour starts its slab's buffers where the previous colour's buffers left off within a page.
+        // With the items an odd number of cache lines apart the colours carry on the walk through the cache sets
+        // rather than repeating the same ones, even when the slab spans a whole number of pages
+        size_t colourOffset = (pool->nextColour * pool->buffersPerSlab * pool->itemSize) % BUFFERPOOLCOLOURALIGN;
+        pool->pSlabCursor = ((uint8_t*)slab) + bufferPoolSlabFirstItemOffset() + colourOffset;
+        pool->slabRemaining = pool->buffersPerSlab;
+        pool->nextColour = (pool->nextColour + 1) % pool->colours;
+    }
+
+    tBufferPoolBufferItem* bufferItem = (tBufferPoolBufferItem*)pool->pSlabCursor;
+    *bufferPoolSlabOfItem(bufferItem) = pool->pSlabListHead;
+    pool->pSlabListHead->carvedBuffers++;
+    pool->pSlabCursor += pool->itemSize;
+    pool->slabRemaining--;
+
+    return bufferItem;
+}
+
 /*!
  * \brief Allocate a new buffer item
  */
@@ -63,13 +196,30 @@ static tBufferPoolBufferItem* bufferPoolAllocBufferItem(tBufferPoolImpl* pool)
     if (pool->maxBuffers == 0 || pool->allocatedBuffers < pool->maxBuffers)
     {
         // Need to allocate more memory
-        bufferItem = malloc(sizeof(tBufferPoolBufferItem) + pool->bufferSize);
+        if (pool->pRegion)
+        {
+            // Mapped pools hand out the items in the region in order
+            bufferItem = bufferPoolRegionItem(pool->pRegion, pool->allocatedBuffers);
+        }
+        else if (pool->colours > 1)
+        {
+            bufferItem = bufferPoolSlabCarveItem(pool);
+        }
+        else
+        {
+            bufferItem = malloc(sizeof(tBufferPoolBufferItem) + pool->bufferSize);
+        }
+
         if (bufferItem)
         {
             bufferItem->magic = BUFFERPOOLMAGIC;
             bufferItem->unique = pool->unique;
             bufferItem->pBufferPool = pool;
             pool->allocatedBuffers++;
+            if (pool->pRegion)
+            {
+                pool->pRegion->allocatedBuffers++;
+            }
         }
         else
         {
@@ -90,8 +240,17 @@ static tBufferPoolBufferItem* bufferPoolAllocBufferItem(tBufferPoolImpl* pool)
  */
 static void bufferPoolAddToFreeList(tBufferPoolImpl* pool, tBufferPoolBufferItem* item)
 {
-    item->pNext = pool->pBufferPoolFreeHead;
-    pool->pBufferPoolFreeHead = item;
+    if (pool->pRegion)
+    {
+        item->nextOffset = pool->pRegion->freeHeadOffset;
+        pool->pRegion->freeHeadOffset = bufferPoolRegionOffset(pool->pRegion, item);
+        pool->pRegion->freeBuffers++;
+    }
+    else
+    {
+        item->pNext = pool->pBufferPoolFreeHead;
+        pool->pBufferPoolFreeHead = item;
+    }
     pool->freeBuffers++;
 }
 
@@ -99,7 +258,17 @@ static tBufferPoolBufferItem* bufferPoolRemoveFromFreeList(tBufferPoolImpl* pool
 {
     tBufferPoolBufferItem* bufferItem = NULL;
 
-    if (pool && pool->pBufferPoolFreeHead)
+    if (pool && pool->pRegion)
+    {
+        if (pool->pRegion->freeHeadOffset)
+        {
+            bufferItem = (tBufferPoolBufferItem*)(((uint8_t*)pool->pRegion) + pool->pRegion->freeHeadOffset);
+            pool->pRegion->freeHeadOffset = bufferItem->nextOffset;
+            pool->pRegion->freeBuffers--;
+            pool->freeBuffers--;
+        }
+    }
+    else if (pool && pool->pBufferPoolFreeHead)
     {
         bufferItem = pool->pBufferPoolFreeHead;
         pool->pBufferPoolFreeHead = bufferItem->pNext;
@@ -177,10 +346,81 @@ static void bufferPoolFree(void* buffer)
     }
 }
 
+/*!
+ * \brief Return the slabs of a coloured pool whose buffers are all on the free list to the heap
+ */
+static bool bufferPoolPurgeSlabs(tBufferPoolImpl* pool)
+{
+    bool freed = false;
+
+    for (tBufferPoolSlab* slab = pool->pSlabListHead; slab != NULL; slab = slab->pNext)
+    {
+        slab->freeBuffers = 0;
+    }
+
+    for (tBufferPoolBufferItem* bufferItem = pool->pBufferPoolFreeHead; bufferItem != NULL; bufferItem = bufferItem->pNext)
+    {
+        (*bufferPoolSlabOfItem(bufferItem))->freeBuffers++;
+    }
+
+    // Unlink the free items that belong to slabs that are about to go
+    for (tBufferPoolBufferItem** ppItem = &pool->pBufferPoolFreeHead; *ppItem != NULL;)
+    {
+        tBufferPoolSlab* slab = *bufferPoolSlabOfItem(*ppItem);
+        if (slab->freeBuffers == slab->carvedBuffers)
+        {
+            (*ppItem)->magic = 0;
+            (*ppItem)->unique = 0;
+            *ppItem = (*ppItem)->pNext;
+            pool->freeBuffers--;
+        }
+        else
+        {
+            ppItem = &(*ppItem)->pNext;
+        }
+    }
+
+    for (tBufferPoolSlab** ppSlab = &pool->pSlabListHead; *ppSlab != NULL;)
+    {
+        tBufferPoolSlab* slab = *ppSlab;
+        if (slab->freeBuffers == slab->carvedBuffers)
+        {
+            // Nothing more can be carved from the current slab once it's gone
+            if (slab == pool->pSlabListHead)
+            {
+                pool->slabRemaining = 0;
+            }
+
+            *ppSlab = slab->pNext;
+            pool->allocatedBuffers -= slab->carvedBuffers;
+            free(slab);
+            freed = true;
+        }
+        else
+        {
+            ppSlab = &slab->pNext;
+        }
+    }
+
+    return freed;
+}
+
 static bool bufferPoolPurgeFreeList(tBufferPool *bufferPool)
 {
     bool freed = false;
     tBufferPoolImpl *pool = bufferPool;
+
+    // The buffers of a persistent pool live in the mapped region and can't be returned to the heap
+    if (pool && pool->pRegion)
+    {
+        return false;
+    }
+
+    if (pool && pool->colours > 1)
+    {
+        return bufferPoolPurgeSlabs(pool);
+    }
+
     tBufferPoolBufferItem *bufferItem = bufferPoolRemoveFromFreeList(pool);
 
     while (bufferItem)
@@ -196,19 +436,50 @@ static bool bufferPoolPurgeFreeList(tBufferPool *bufferPool)
     return freed;
 }
 
-static tBufferPool* bufferPoolCreate(const char* name, const size_t bufferSize, const uint32_t preAllocation, const uint32_t maxAllocation)
+static tBufferPool* bufferPoolCreateColoured(const char* name, const size_t bufferSize, const uint32_t preAllocation, const uint32_t maxAllocation, const uint32_t colours)
 {
     assert(bufferSize > 0);
     assert(maxAllocation == 0 || maxAllocation >= preAllocation);
+    assert(colours > 0 && colours <= BUFFERPOOLMAXCOLOURS);
 
     // The bufferSize must be greater than zero and if maxAllocation is not zero then it must be greater than maxAllocation
-    if (bufferSize > 0 && (maxAllocation == 0 || maxAllocation >= preAllocation))
+    if (bufferSize > 0 && (maxAllocation == 0 || maxAllocation >= preAllocation) && colours > 0 && colours <= BUFFERPOOLMAXCOLOURS)
     {
         tBufferPoolImpl* bufferPool = calloc(sizeof(tBufferPoolImpl), 1);
 
         // Save the pool parameters
         bufferPool->maxBuffers = maxAllocation;
         bufferPool->bufferSize = bufferSize;
+        bufferPool->colours = colours;
+
+        if (colours > 1)
+        {
+            // An odd number of cache lines between items walks successive buffers through every cache set in a page.
+            // An even number, such as when the buffer and header add up to a power of two, would keep hitting the same few
+            bufferPool->itemSize = (BUFFERPOOLSLABITEMHEADER + sizeof(tBufferPoolBufferItem) + bufferSize + BUFFERPOOLCOLOURSTRIDE - 1) & ~(size_t)(BUFFERPOOLCOLOURSTRIDE - 1);
+            if ((bufferPool->itemSize / BUFFERPOOLCOLOURSTRIDE) % 2 == 0)
+            {
+                bufferPool->itemSize += BUFFERPOOLCOLOURSTRIDE;
+            }
+
+            // Likewise buffers spanning several pages are spaced an odd number of pages apart, so their pages
+            // spread over the sets of the TLB. An even number of pages would put every buffer in a slab in the same few
+            size_t itemPages = bufferPool->itemSize / BUFFERPOOLCOLOURALIGN;
+            if (itemPages > 1 && itemPages % 2 == 0)
+            {
+                bufferPool->itemSize += BUFFERPOOLCOLOURALIGN;
+            }
+
+            // Size the slabs so that between them the colours cover every cache set, plus up to a page of padding for the colour offset
+            uint32_t slabBuffers = (BUFFERPOOLCOLOURLINES + colours - 1) / colours;
+            if (slabBuffers < BUFFERPOOLSLABBUFFERS)
+            {
+                slabBuffers = BUFFERPOOLSLABBUFFERS;
+            }
+            size_t colourSpace = bufferPoolSlabFirstItemOffset() + BUFFERPOOLCOLOURALIGN - BUFFERPOOLCOLOURSTRIDE;
+            bufferPool->slabSize = (colourSpace + slabBuffers * bufferPool->itemSize + BUFFERPOOLCOLOURALIGN - 1) & ~(size_t)(BUFFERPOOLCOLOURALIGN - 1);
+            bufferPool->buffersPerSlab = (bufferPool->slabSize - colourSpace) / bufferPool->itemSize;
+        }
 
         // Set up the identity of the pool
         bufferPool->name = name;
@@ -235,6 +506,286 @@ static tBufferPool* bufferPoolCreate(const char* name, const size_t bufferSize,
     return NULL;
 }
 
+static tBufferPool* bufferPoolCreate(const char* name, const size_t bufferSize, const uint32_t preAllocation, const uint32_t maxAllocation)
+{
+    return bufferPoolCreateColoured(name, bufferSize, preAllocation, maxAllocation, 1);
+}
+
+/*!
+ * \brief Check the header and free list of a previously written region and take ownership of its items
+ */
+static bool bufferPoolRegionAttach(tBufferPoolImpl* pool, tBufferPoolRegionHeader* region)
+{
+    if (region->magic != BUFFERPOOLREGIONMAGIC ||
+        region->bufferSize != pool->bufferSize ||
+        region->maxBuffers != pool->maxBuffers ||
+        region->allocatedBuffers > region->maxBuffers)
+    {
+        return false;
+    }
+
+    // Every item handed out so far must belong to this pool
+    for (uint32_t i = 0; i < region->allocatedBuffers; i++)
+    {
+        tBufferPoolBufferItem* bufferItem = bufferPoolRegionItem(region, i);
+        if (bufferItem->magic != BUFFERPOOLMAGIC || bufferItem->unique != region->unique)
+        {
+            return false;
+        }
+    }
+
+    // Walk the free list checking each link lands on an allocated item
+    // Bounding the walk by the allocated count also catches a corrupted list with a loop in it
+    uint32_t freeBuffers = 0;
+    uint64_t lastOffset = region->firstItemOffset + region->allocatedBuffers * region->itemSize;
+    for (uint64_t offset = region->freeHeadOffset; offset != 0; offset = ((tBufferPoolBufferItem*)(((uint8_t*)region) + offset))->nextOffset)
+    {
+        if (offset < region->firstItemOffset || offset >= lastOffset ||
+            (offset - region->firstItemOffset) % region->itemSize != 0 ||
+            ++freeBuffers > region->allocatedBuffers)
+        {
+            return false;
+        }
+    }
+
+    // The free count is updated separately from the list itself, so a process killed part way
+    // through a free or alloc leaves it out of step. The list is what counts, so recount from it
+    region->freeBuffers = freeBuffers;
+
+    // The pool pointers are only valid for this run so fix them up
+    for (uint32_t i = 0; i < region->allocatedBuffers; i++)
+    {
+        bufferPoolRegionItem(region, i)->pBufferPool = pool;
+    }
+
+    pool->unique = region->unique;
+    pool->allocatedBuffers = region->allocatedBuffers;
+    pool->freeBuffers = region->freeBuffers;
+
+    return true;
+}
+
+/*!
+ * \brief Create a pool in a single mapped region, backed by the given file or anonymous memory if path is NULL
+ */
+static tBufferPool* bufferPoolCreateMapped(const char* name, const char* path, const size_t bufferSize, const uint32_t maxAllocation)
+{
+    assert(bufferSize > 0);
+    assert(maxAllocation > 0);
+
+    // A mapped pool has a fixed size region so there must be a limit on the number of buffers
+    if (bufferSize == 0 || maxAllocation == 0)
+    {
+        return NULL;
+    }
+
+    uint64_t firstItemOffset = (sizeof(tBufferPoolRegionHeader) + BUFFERPOOLREGIONALIGN - 1) & ~(uint64_t)(BUFFERPOOLREGIONALIGN - 1);
+    uint64_t itemSize = (sizeof(tBufferPoolBufferItem) + bufferSize + BUFFERPOOLREGIONALIGN - 1) & ~(uint64_t)(BUFFERPOOLREGIONALIGN - 1);
+    size_t regionSize = firstItemOffset + maxAllocation * itemSize;
+
+    void* mapping = MAP_FAILED;
+    bool newRegion = false;
+    int fd = -1;
+
+    if (path == NULL)
+    {
+        mapping = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        newRegion = true;
+    }
+    else
+    {
+        fd = open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0)
+        {
+            return NULL;
+        }
+
+        // Only one pool may be attached to the file at a time, including one in another process
+        // that hasn't finished shutting down. The lock is held until the pool is detached
+        struct stat fileStat;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &fileStat) != 0)
+        {
+            close(fd);
+            return NULL;
+        }
+
+        if (fileStat.st_size == 0)
+        {
+            if (ftruncate(fd, regionSize) != 0)
+            {
+                close(fd);
+                return NULL;
+            }
+            newRegion = true;
+        }
+        else if (fileStat.st_size != (off_t)regionSize)
+        {
+            // The file holds a pool of a different shape, leave it alone
+            close(fd);
+            return NULL;
+        }
+
+        mapping = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    if (mapping == MAP_FAILED)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    tBufferPoolRegionHeader* region = mapping;
+    tBufferPoolImpl* bufferPool = calloc(sizeof(tBufferPoolImpl), 1);
+
+    // Save the pool parameters
+    bufferPool->maxBuffers = maxAllocation;
+    bufferPool->bufferSize = bufferSize;
+    bufferPool->colours = 1;
+    bufferPool->name = name;
+    bufferPool->regionSize = regionSize;
+    bufferPool->fd = fd;
+
+    // The magic number is written last when laying out a new region, with a release store so neither the
+    // compiler nor the CPU can move it ahead of the rest of the header. A region without one was never
+    // completely set up (e.g. the process died part way through) and is started afresh
+    if (newRegion || region->magic == 0)
+    {
+        region->unique = rand(); // Random number to identify this pool
+        region->bufferSize = bufferSize;
+        region->itemSize = itemSize;
+        region->firstItemOffset = firstItemOffset;
+        region->freeHeadOffset = 0;
+        region->maxBuffers = maxAllocation;
+        region->allocatedBuffers = 0;
+        region->freeBuffers = 0;
+        __atomic_store_n(&region->magic, BUFFERPOOLREGIONMAGIC, __ATOMIC_RELEASE);
+        bufferPool->unique = region->unique;
+    }
+    else if (region->itemSize != itemSize || region->firstItemOffset != firstItemOffset || !bufferPoolRegionAttach(bufferPool, region))
+    {
+        munmap(mapping, regionSize);
+        close(fd);
+        free(bufferPool);
+        return NULL;
+    }
+
+    bufferPool->pRegion = region;
+    bufferPool->magic = BUFFERPOOLMAGIC;
+
+    // Add the new pool to the list of pools
+    bufferPool->pNextPool = mpBufferPoolListHead;
+    mpBufferPoolListHead = bufferPool;
+
+    return (tBufferPool*)bufferPool;
+}
+
+static tBufferPool* bufferPoolCreatePersistent(const char* name, const char* path, const size_t bufferSize, const uint32_t maxAllocation)
+{
+    assert(path != NULL);
+
+    if (path == NULL)
+    {
+        return NULL;
+    }
+
+    return bufferPoolCreateMapped(name, path, bufferSize, maxAllocation);
+}
+
+static tBufferPool* bufferPoolCreateContiguous(const char* name, const size_t bufferSize, const uint32_t maxAllocation)
+{
+    return bufferPoolCreateMapped(name, NULL, bufferSize, maxAllocation);
+}
+
+static void bufferPoolRecoverBuffers(tBufferPool* bufferPool, void (*callback)(void* buffer, void* context), void* context)
+{
+    tBufferPoolImpl* pool = bufferPool;
+    if (pool && pool->magic == BUFFERPOOLMAGIC && pool->pRegion && callback)
+    {
+        tBufferPoolRegionHeader* region = pool->pRegion;
+        bool* isFree = calloc(pool->allocatedBuffers + 1, sizeof(bool));
+        if (isFree)
+        {
+            for (uint64_t offset = region->freeHeadOffset; offset != 0; offset = ((tBufferPoolBufferItem*)(((uint8_t*)region) + offset))->nextOffset)
+            {
+                isFree[(offset - region->firstItemOffset) / region->itemSize] = true;
+            }
+
+            // Anything that has been handed out and isn't on the free list is still in use
+            for (uint32_t i = 0; i < pool->allocatedBuffers; i++)
+            {
+                if (!isFree[i])
+                {
+                    callback(((uint8_t*)bufferPoolRegionItem(region, i)) + sizeof(tBufferPoolBufferItem), context);
+                }
+            }
+
+            free(isFree);
+        }
+    }
+}
+
+static bool bufferPoolDetach(tBufferPool* bufferPool)
+{
+    tBufferPoolImpl* pool = bufferPool;
+    if (pool && pool->magic == BUFFERPOOLMAGIC && pool->pRegion)
+    {
+        // Remove the pool from the list of pools
+        for (tBufferPoolImpl** ppPool = &mpBufferPoolListHead; *ppPool != NULL; ppPool = &(*ppPool)->pNextPool)
+        {
+            if (*ppPool == pool)
+            {
+                *ppPool = pool->pNextPool;
+                break;
+            }
+        }
+
+        msync(pool->pRegion, pool->regionSize, MS_SYNC);
+        munmap(pool->pRegion, pool->regionSize);
+
+        // Closing the file releases the lock so the pool can be attached again
+        if (pool->fd >= 0)
+        {
+            close(pool->fd);
+        }
+
+        pool->magic = 0;
+        pool->unique = 0;
+        free(pool);
+        return true;
+    }
+    return false;
+}
+
+static int32_t bufferPoolGetBufferIndex(void* buffer)
+{
+    if (buffer)
+    {
+        tBufferPoolBufferItem* bufferItem = (tBufferPoolBufferItem*)(((uint8_t*)buffer) - sizeof(tBufferPoolBufferItem));
+        if (bufferItem->magic == BUFFERPOOLMAGIC)
+        {
+            tBufferPoolImpl* pool = bufferItem->pBufferPool;
+            if (pool && pool->magic == BUFFERPOOLMAGIC && bufferItem->unique == pool->unique && pool->pRegion)
+            {
+                return (bufferPoolRegionOffset(pool->pRegion, bufferItem) - pool->pRegion->firstItemOffset) / pool->pRegion->itemSize;
+            }
+        }
+    }
+    return -1;
+}
+
+static void* bufferPoolGetBufferByIndex(tBufferPool* bufferPool, const uint32_t index)
+{
+    tBufferPoolImpl* pool = bufferPool;
+    if (pool && pool->magic == BUFFERPOOLMAGIC && pool->pRegion && index < pool->maxBuffers)
+    {
+        return ((uint8_t*)bufferPoolRegionItem(pool->pRegion, index)) + sizeof(tBufferPoolBufferItem);
+    }
+    return NULL;
+}
+
 static const char* bufferPoolGetName(tBufferPool *bufferPool)
 {
     tBufferPoolImpl *pool = bufferPool;
@@ -252,6 +803,7 @@ static void bufferPoolGetStats(tBufferPool *bufferPool, tBufferPoolStats *stats)
     {
         stats->bufferSize = pool->bufferSize;
         stats->maxBuffers = pool->maxBuffers;
+        stats->colours = pool->colours;
         stats->allocatedBuffers = pool->allocatedBuffers;
         stats->freeBuffers = pool->freeBuffers;
         stats->totalAllocationRequests = pool->totalAllocationRequests;
@@ -269,6 +821,7 @@ static void bufferPoolPrintStats(tBufferPool* bufferPool)
       printf("Buffer pool name            : %s\n", pool->name);
       printf("  Buffer size               : %zu bytes\n", pool->bufferSize);
       printf("  Max buffers               : %d (0 means unlimited)\n", pool->maxBuffers);
+      printf("  Cache colours             : %d\n", pool->colours);
       printf("  Allocated buffers         : %d\n", pool->allocatedBuffers);
       printf("  Free buffers              : %d\n", pool->freeBuffers);
       printf("  Total allocation requests : %d\n", pool->totalAllocationRequests);
@@ -293,6 +846,13 @@ static void bufferPoolDumpStats(void)
 tBufferPoolController com_wadsweb_bufferpool =
 {
     .create = &bufferPoolCreate,
+    .createColoured = &bufferPoolCreateColoured,
+    .createPersistent = &bufferPoolCreatePersistent,
+    .createContiguous = &bufferPoolCreateContiguous,
+    .recoverBuffers = &bufferPoolRecoverBuffers,
+    .detach = &bufferPoolDetach,
+    .getBufferIndex = &bufferPoolGetBufferIndex,
+    .getBufferByIndex = &bufferPoolGetBufferByIndex,
     .alloc = &bufferPoolAlloc,
     .calloc = &bufferPoolCalloc,
     .free = &bufferPoolFree,
@@ -22,6 +22,7 @@ typedef struct
     uint32_t allocatedBuffers;        //!< Total number of buffers allocated
     uint32_t freeBuffers;             //!< Number of buffers currently free
     uint32_t maxBuffers;              //!< Maximum allowed number of buffers (0 == unlimited)
+    uint32_t colours;                 //!< Number of cache colours buffers are staggered across (1 == no colouring)
     uint32_t outOfBuffers;            //!< Count of how many times the max buffers limit has been hit
     uint32_t outOfMemory;             //!< Count of how many out of memory errors there have been on this pool
     uint32_t totalAllocationRequests; //!< Total number of requests for buffers
@@ -40,6 +41,104 @@ typedef struct
      */
     tBufferPool* (*create)(const char* name, const size_t bufferSize, const uint32_t preAllocation, const uint32_t maxAllocation);
 
+    /*!
+     * \brief Create a new buffer pool with cache colouring
+     *
+     * Buffers are carved out of page aligned slabs holding several buffers each. The buffers
+     * are cache line aligned and spaced an odd number of cache lines apart, so successive
+     * buffers start in different cache sets even when their size is a power of two. Each
+     * successive slab, cycling through the given number of colours, starts its buffers where
+     * the previous slab's left off within a page. Slabs hold at least 64 / colours buffers, so
+     * between them the colours start buffers in every cache set of a page whatever the number
+     * of colours. Buffers spanning several pages are also spaced an odd number of pages apart
+     * so their pages don't all share TLB sets. The padding costs up to a page per slab, and up
+     * to a cache line per buffer, or a page per buffer for buffers of two or more pages.
+     *
+     * \param name The name to give the pool
+     * \param bufferSize The size of the individual buffers in bytes
+     * \param preAllocation How many buffers to initially create and add to the free list
+     * \param maxAllocation The maximum number of buffers allowed in this pool
+     * \param colours The number of colours to cycle through (1 to 64, 1 == no colouring)
+     * \returns New buffer pool or NULL
+     */
+    tBufferPool* (*createColoured)(const char* name, const size_t bufferSize, const uint32_t preAllocation, const uint32_t maxAllocation, const uint32_t colours);
+
+    /*!
+     * \brief Create or re-attach a persistent buffer pool backed by a memory mapped file
+     *
+     * If the file is empty a new pool is laid out in it with room for maxAllocation buffers.
+     * Otherwise the pool already in the file is re-attached, after checking that it has the
+     * same buffer size and limit and that its free list is intact. Buffers that were in use
+     * when the pool was last detached (or the process exited) can be found with recoverBuffers.
+     * The free count is rebuilt from the free list, as a process killed part way through an
+     * alloc or free can leave the stored count out of step with the list.
+     * A file whose pool was never completely laid out, such as after a crash during creation,
+     * is set up as a new pool. The file is locked while the pool is attached, so attaching it
+     * a second time, from this or another process, fails until the pool is detached.
+     *
+     * \param name The name to give the pool
+     * \param path The file to hold the buffers and pool metadata
+     * \param bufferSize The size of the individual buffers in bytes
+     * \param maxAllocation The maximum number of buffers allowed in this pool (must not be zero)
+     * \returns New buffer pool or NULL if the file can't be mapped, is already attached or holds an incompatible or corrupt pool
+     */
+    tBufferPool* (*createPersistent)(const char* name, const char* path, const size_t bufferSize, const uint32_t maxAllocation);
+
+    /*!
+     * \brief Create a buffer pool with all of its buffers in a single contiguous region of memory
+     *
+     * Room for maxAllocation buffers is reserved up front and each buffer has a fixed index
+     * within the region. This suits interfaces that need to register the buffer memory ahead
+     * of time, such as io_uring fixed buffers.
+     *
+     * \param name The name to give the pool
+     * \param bufferSize The size of the individual buffers in bytes
+     * \param maxAllocation The maximum number of buffers allowed in this pool (must not be zero)
+     * \returns New buffer pool or NULL
+     */
+    tBufferPool* (*createContiguous)(const char* name, const size_t bufferSize, const uint32_t maxAllocation);
+
+    /*!
+     * \brief Report the buffers of a persistent pool that are not on the free list
+     *
+     * The callback is called once for each in use buffer. The buffers can be used as normal
+     * and released with free when the application is done with them.
+     *
+     * \param bufferPool The persistent buffer pool to recover buffers from
+     * \param callback Function to call with each in use buffer
+     * \param context Passed through to the callback
+     */
+    void (*recoverBuffers)(tBufferPool* bufferPool, void (*callback)(void* buffer, void* context), void* context);
+
+    /*!
+     * \brief Unmap a persistent or contiguous pool, flushing a persistent pool to its file first
+     *
+     * The pool and all of its buffers are invalid after this call.
+     *
+     * \param bufferPool The persistent or contiguous buffer pool to detach
+     * \returns true if the pool was detached, false if it isn't a persistent or contiguous pool
+     */
+    bool (*detach)(tBufferPool* bufferPool);
+
+    /*!
+     * \brief Get the index of a buffer within its persistent or contiguous pool
+     *
+     * \param buffer The buffer to look up
+     * \returns Index of the buffer or -1 if it doesn't belong to a persistent or contiguous pool
+     */
+    int32_t (*getBufferIndex)(void* buffer);
+
+    /*!
+     * \brief Get the buffer at the given index within a persistent or contiguous pool
+     *
+     * Every index below the pool's maximum maps to a buffer, whether or not it has been allocated yet.
+     *
+     * \param bufferPool The persistent or contiguous buffer pool
+     * \param index The index of the buffer
+     * \returns The buffer or NULL if the index is out of range or the pool isn't persistent or contiguous
+     */
+    void* (*getBufferByIndex)(tBufferPool* bufferPool, const uint32_t index);
+
     /*!
      * \brief Allocate a buffer
      *
@@ -74,6 +173,8 @@ typedef struct
     /*!
      * \brief Return any buffers that are on the free list to the heap
      *
+     * For a coloured pool only slabs with all of their buffers free can be returned.
+     *
      * \param bufferPool The buffer pool to purge
      */
     bool (*purgeFreeList)(tBufferPool *bufferPool);
@@ -0,0 +1,242 @@
+/*!
+ * \brief io_uring integration for contiguous buffer pools
+ *
+ * Talks to the kernel through the raw io_uring_register system call so it can be
+ * used with liburing or any other way of setting up the ring.
+ *
+ */
+
+#define _DEFAULT_SOURCE // For syscall and the memory mapping functions
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "bufferpool_uring.h"
+
+// Magic number to confirm this really is a buffer ring we are dealing with
+#define BUFFERPOOLBUFRINGMAGIC 0x5533AAFF
+
+// Buffer IDs are 16 bits and the ring size must be a power of two no bigger than this
+#define BUFFERPOOLBUFRINGMAXENTRIES 32768
+
+// Most buffers the kernel will register as fixed buffers (its IORING_MAX_REG_BUFFERS, which isn't exported)
+#define BUFFERPOOLMAXFIXEDBUFFERS 16384
+
+// Internal representation of a provided buffer ring
+typedef struct
+{
+    uint32_t magic;                  //!< Magic number to identify a buffer ring
+    tBufferPool* pBufferPool;        //!< Buffer pool the ring provides buffers from
+    struct io_uring_buf_ring* pRing; //!< Ring shared with the kernel
+    size_t ringSize;                 //!< Size of the shared ring in bytes
+    size_t bufferSize;               //!< Size of the buffers in the pool
+    bool* pProvided;                 //!< Which buffers, by index, are currently held by the kernel
+    int ringFd;                      //!< io_uring the ring is registered with
+    uint16_t groupId;                //!< Buffer group ID the ring is registered as
+    uint16_t mask;                   //!< Number of entries in the ring minus one
+    uint16_t tail;                   //!< Next entry to fill in
+} tBufferPoolBufRingImpl;
+
+/** Private functions **/
+
+static int bufferPoolUringRegister(int ringFd, unsigned int opcode, void* arg, unsigned int nrArgs)
+{
+    return syscall(__NR_io_uring_register, ringFd, opcode, arg, nrArgs);
+}
+
+/** Public API **/
+
+static bool bufferPoolUringRegisterBuffers(tBufferPool* bufferPool, int ringFd)
+{
+    tBufferPoolStats stats;
+    bool success = false;
+
+    // Only pools in a single region have a buffer for every index
+    if (com_wadsweb_bufferpool.getBufferByIndex(bufferPool, 0) == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    com_wadsweb_bufferpool.getStats(bufferPool, &stats);
+    if (stats.maxBuffers > BUFFERPOOLMAXFIXEDBUFFERS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct iovec* iovecs = calloc(stats.maxBuffers, sizeof(struct iovec));
+    if (iovecs)
+    {
+        for (uint32_t i = 0; i < stats.maxBuffers; i++)
+        {
+            iovecs[i].iov_base = com_wadsweb_bufferpool.getBufferByIndex(bufferPool, i);
+            iovecs[i].iov_len = stats.bufferSize;
+        }
+
+        success = (bufferPoolUringRegister(ringFd, IORING_REGISTER_BUFFERS, iovecs, stats.maxBuffers) == 0);
+        free(iovecs);
+    }
+    else
+    {
+        errno = ENOMEM;
+    }
+
+    return success;
+}
+
+static bool bufferPoolUringUnregisterBuffers(int ringFd)
+{
+    return bufferPoolUringRegister(ringFd, IORING_UNREGISTER_BUFFERS, NULL, 0) == 0;
+}
+
+static tBufferPoolBufRing* bufferPoolUringCreateBufRing(tBufferPool* bufferPool, int ringFd, const uint16_t groupId)
+{
+    tBufferPoolStats stats;
+
+    if (com_wadsweb_bufferpool.getBufferByIndex(bufferPool, 0) == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    com_wadsweb_bufferpool.getStats(bufferPool, &stats);
+    if (stats.maxBuffers > BUFFERPOOLBUFRINGMAXENTRIES)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Make the ring big enough to hold every buffer in the pool at once
+    uint32_t entries = 1;
+    while (entries < stats.maxBuffers)
+    {
+        entries <<= 1;
+    }
+
+    // The kernel needs the ring to be page aligned
+    size_t ringSize = entries * sizeof(struct io_uring_buf);
+    void* ring = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    struct io_uring_buf_reg reg =
+    {
+        .ring_addr = (uint64_t)(uintptr_t)ring,
+        .ring_entries = entries,
+        .bgid = groupId,
+    };
+
+    if (bufferPoolUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+    {
+        int error = errno;
+        munmap(ring, ringSize);
+        errno = error;
+        return NULL;
+    }
+
+    tBufferPoolBufRingImpl* bufRing = calloc(sizeof(tBufferPoolBufRingImpl), 1);
+    bool* provided = calloc(stats.maxBuffers, sizeof(bool));
+    if (bufRing == NULL || provided == NULL)
+    {
+        free(bufRing);
+        free(provided);
+        bufferPoolUringRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(ring, ringSize);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    bufRing->pBufferPool = bufferPool;
+    bufRing->pRing = ring;
+    bufRing->ringSize = ringSize;
+    bufRing->bufferSize = stats.bufferSize;
+    bufRing->pProvided = provided;
+    bufRing->ringFd = ringFd;
+    bufRing->groupId = groupId;
+    bufRing->mask = entries - 1;
+    bufRing->magic = BUFFERPOOLBUFRINGMAGIC;
+
+    return (tBufferPoolBufRing*)bufRing;
+}
+
+static bool bufferPoolUringProvide(tBufferPoolBufRing* bufferRing, void* buffer)
+{
+    tBufferPoolBufRingImpl* bufRing = bufferRing;
+    if (bufRing && bufRing->magic == BUFFERPOOLBUFRINGMAGIC)
+    {
+        // The buffer must be from the pool behind this ring and not already held by the kernel.
+        // The ring has an entry for every buffer, so that is all it takes to keep it from overflowing
+        int32_t index = com_wadsweb_bufferpool.getBufferIndex(buffer);
+        if (index >= 0 && com_wadsweb_bufferpool.getBufferByIndex(bufRing->pBufferPool, index) == buffer && !bufRing->pProvided[index])
+        {
+            bufRing->pProvided[index] = true;
+
+            struct io_uring_buf* entry = &bufRing->pRing->bufs[bufRing->tail & bufRing->mask];
+            entry->addr = (uint64_t)(uintptr_t)buffer;
+            entry->len = bufRing->bufferSize;
+            entry->bid = index;
+
+            // Publish the entry to the kernel
+            bufRing->tail++;
+            __atomic_store_n(&bufRing->pRing->tail, bufRing->tail, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* bufferPoolUringGetSelectedBuffer(tBufferPoolBufRing* bufferRing, const uint32_t cqeFlags)
+{
+    tBufferPoolBufRingImpl* bufRing = bufferRing;
+    if (bufRing && bufRing->magic == BUFFERPOOLBUFRINGMAGIC && (cqeFlags & IORING_CQE_F_BUFFER))
+    {
+        uint32_t index = cqeFlags >> IORING_CQE_BUFFER_SHIFT;
+        void* buffer = com_wadsweb_bufferpool.getBufferByIndex(bufRing->pBufferPool, index);
+        if (buffer)
+        {
+            // The kernel has handed the buffer back
+            bufRing->pProvided[index] = false;
+        }
+        return buffer;
+    }
+    return NULL;
+}
+
+static void bufferPoolUringDestroyBufRing(tBufferPoolBufRing* bufferRing)
+{
+    tBufferPoolBufRingImpl* bufRing = bufferRing;
+    if (bufRing && bufRing->magic == BUFFERPOOLBUFRINGMAGIC)
+    {
+        struct io_uring_buf_reg reg =
+        {
+            .bgid = bufRing->groupId,
+        };
+
+        bufferPoolUringRegister(bufRing->ringFd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(bufRing->pRing, bufRing->ringSize);
+        free(bufRing->pProvided);
+
+        bufRing->magic = 0;
+        free(bufRing);
+    }
+}
+
+tBufferPoolUringController com_wadsweb_bufferpool_uring =
+{
+    .registerBuffers = &bufferPoolUringRegisterBuffers,
+    .unregisterBuffers = &bufferPoolUringUnregisterBuffers,
+    .createBufRing = &bufferPoolUringCreateBufRing,
+    .provide = &bufferPoolUringProvide,
+    .getSelectedBuffer = &bufferPoolUringGetSelectedBuffer,
+    .destroyBufRing = &bufferPoolUringDestroyBufRing,
+};
@@ -0,0 +1,99 @@
+/*!
+ * \brief io_uring integration for contiguous buffer pools
+ *
+ * Lets the buffers of a contiguous buffer pool be used directly by io_uring, either
+ * as registered fixed buffers for READ_FIXED/WRITE_FIXED or through a provided buffer
+ * ring for buffer select. In both cases the kernel's buffer index is the buffer's index
+ * within the pool, as returned by getBufferIndex.
+ *
+ * Persistent pools work with a provided buffer ring wherever their file lives, but the
+ * kernel only lets memory mapped from tmpfs or hugetlbfs (e.g. a file in /dev/shm) be
+ * registered as fixed buffers. A persistent pool on an ordinary filesystem fails to
+ * register with EFAULT.
+ *
+ * The ring itself is owned by the caller and is identified by its file descriptor.
+ *
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bufferpool.h"
+
+typedef void tBufferPoolBufRing;
+
+typedef struct
+{
+    /*!
+     * \brief Register every buffer in the pool with the ring as fixed buffers
+     *
+     * Registered buffer i is the pool buffer at index i, so a buffer from alloc can be
+     * used with READ_FIXED/WRITE_FIXED by setting buf_index to its getBufferIndex value.
+     * The kernel takes at most 16384 fixed buffers, so larger pools fail with EINVAL.
+     * A persistent pool must have its file on tmpfs or hugetlbfs, otherwise the kernel
+     * fails the registration with EFAULT.
+     *
+     * \param bufferPool The contiguous buffer pool to register (at most 16384 buffers)
+     * \param ringFd The io_uring file descriptor
+     * \returns true on success, false with errno set on failure
+     */
+    bool (*registerBuffers)(tBufferPool* bufferPool, int ringFd);
+
+    /*!
+     * \brief Unregister the fixed buffers from the ring
+     *
+     * \param ringFd The io_uring file descriptor
+     * \returns true on success, false with errno set on failure
+     */
+    bool (*unregisterBuffers)(int ringFd);
+
+    /*!
+     * \brief Create a provided buffer ring for buffer select and register it with the ring
+     *
+     * The ring has room for every buffer in the pool, and provide refuses a buffer the
+     * kernel already holds, so the ring can't overflow.
+     * Needs a kernel with IORING_REGISTER_PBUF_RING (5.19 or later).
+     *
+     * \param bufferPool The contiguous buffer pool to provide buffers from (at most 32768 buffers)
+     * \param ringFd The io_uring file descriptor
+     * \param groupId The buffer group ID to use in sqe->buf_group
+     * \returns New buffer ring or NULL with errno set
+     */
+    tBufferPoolBufRing* (*createBufRing)(tBufferPool* bufferPool, int ringFd, const uint16_t groupId);
+
+    /*!
+     * \brief Hand a buffer to the kernel for use by buffer select
+     *
+     * The buffer should come from alloc and stays owned by the kernel until it is
+     * returned in a completion and passed to getSelectedBuffer.
+     *
+     * \param bufRing The buffer ring to add to
+     * \param buffer The buffer to provide
+     * \returns true if the buffer was provided, false if it doesn't belong to the ring's pool
+     *          or has already been provided and not yet returned
+     */
+    bool (*provide)(tBufferPoolBufRing* bufRing, void* buffer);
+
+    /*!
+     * \brief Get the buffer the kernel picked for a completion
+     *
+     * This hands the buffer back to the application, after which it can be provided again.
+     *
+     * \param bufRing The buffer ring the request selected from
+     * \param cqeFlags The flags from the completion queue entry
+     * \returns The selected buffer or NULL if the completion didn't use a buffer
+     */
+    void* (*getSelectedBuffer)(tBufferPoolBufRing* bufRing, const uint32_t cqeFlags);
+
+    /*!
+     * \brief Unregister and release a buffer ring
+     *
+     * Buffers still held by the kernel are not freed back to the pool.
+     *
+     * \param bufRing The buffer ring to destroy
+     */
+    void (*destroyBufRing)(tBufferPoolBufRing* bufRing);
+} tBufferPoolUringController;
+
+extern tBufferPoolUringController com_wadsweb_bufferpool_uring;
@@ -1,4 +1,9 @@
+#define _DEFAULT_SOURCE // For pread and pwrite
+
 #include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "unity.h"
 #include "bufferpool.h"
@@ -15,6 +20,7 @@ void test_CreateBufferPool(void)
     TEST_ASSERT_EQUAL_STRING_MESSAGE(poolName, com_wadsweb_bufferpool.getName(bufferpool), "Name incorrect\n");
     TEST_ASSERT_EQUAL_MESSAGE(8, stats.bufferSize, "Buffer size incorrect\n");
     TEST_ASSERT_EQUAL_MESSAGE(0, stats.maxBuffers, "Max buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(1, stats.colours, "Colours incorrect\n");
     TEST_ASSERT_EQUAL_MESSAGE(0, stats.freeBuffers, "Free buffers incorrect\n");
     TEST_ASSERT_EQUAL_MESSAGE(0, stats.allocatedBuffers, "Allocated buffers incorrect\n");
     TEST_ASSERT_EQUAL_MESSAGE(0, stats.outOfBuffers, "Out of buffers incorrect\n");
@@ -293,6 +299,456 @@ void test_AllocFreeAndPurge(void)
     TEST_ASSERT_EQUAL_MESSAGE(4, stats.totalAllocationRequests, "Total allocation requests incorrect\n");
 }
 
+void test_ColouredBuffers(void)
+{
+    tBufferPoolStats stats;
+    char *poolName = "test_coloured_buffers";
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createColoured(poolName, 4096, 0, 0, 4);
+
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+    TEST_ASSERT_EQUAL_MESSAGE(4096, stats.bufferSize, "Buffer size incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(4, stats.colours, "Colours incorrect\n");
+
+    // Enough buffers to fill several slabs
+    void *buffers[96];
+    for (uint32_t i = 0; i < 96; i++)
+    {
+        buffers[i] = com_wadsweb_bufferpool.alloc(bufferpool);
+        TEST_ASSERT_NOT_NULL_MESSAGE(buffers[i], "Buffer is NULL\n");
+        TEST_ASSERT_EQUAL_MESSAGE(0, (uintptr_t)buffers[i] % 64, "Buffer not cache line aligned\n");
+    }
+
+    // Buffers within a slab are packed together, so a different gap marks the start of a new slab.
+    // The slabs are page aligned and each colour starts its buffers a fixed step further into the page, wrapping after 4
+    uintptr_t slabStarts[5];
+    uint32_t slabs = 1;
+    slabStarts[0] = (uintptr_t)buffers[0] % 4096;
+    for (uint32_t i = 1; i < 96 && slabs < 5; i++)
+    {
+        if ((uintptr_t)buffers[i] != (uintptr_t)buffers[i - 1] + ((uintptr_t)buffers[1] - (uintptr_t)buffers[0]))
+        {
+            slabStarts[slabs++] = (uintptr_t)buffers[i] % 4096;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_MESSAGE(5, slabs, "Too few slabs\n");
+    uintptr_t step = (slabStarts[1] + 4096 - slabStarts[0]) % 4096;
+    TEST_ASSERT_TRUE_MESSAGE(step != 0, "Slab not coloured\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, step % 64, "Colour not a whole number of cache lines\n");
+    for (uint32_t i = 1; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL_MESSAGE((slabStarts[0] + i * step) % 4096, slabStarts[i], "Slab not coloured\n");
+    }
+    TEST_ASSERT_EQUAL_MESSAGE(slabStarts[0], slabStarts[4], "Colours did not wrap\n");
+
+    // A slab can't be purged while any of its buffers are in use
+    com_wadsweb_bufferpool.free(buffers[0]);
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool.purgeFreeList(bufferpool), "Slab in use purged\n");
+
+    for (uint32_t i = 1; i < 96; i++)
+    {
+        com_wadsweb_bufferpool.free(buffers[i]);
+    }
+
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_EQUAL_MESSAGE(96, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(96, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.purgeFreeList(bufferpool), "Nothing purged\n");
+
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    // The pool still works after the slabs have gone
+    buffers[0] = com_wadsweb_bufferpool.alloc(bufferpool);
+    TEST_ASSERT_NOT_NULL_MESSAGE(buffers[0], "Buffer is NULL after purge\n");
+    com_wadsweb_bufferpool.free(buffers[0]);
+}
+
+void test_ColouredPageSizedItems(void)
+{
+    // With the 32 bytes a coloured pool keeps in front of each buffer these take up exactly a page, so without care they would
+    // all start in the same cache set
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createColoured("test_coloured_page_sized_items", 4064, 0, 0, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+
+    void *buffers[64];
+    bool lineUsed[64] = { false };
+    uint32_t linesUsed = 0;
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        buffers[i] = com_wadsweb_bufferpool.alloc(bufferpool);
+        TEST_ASSERT_NOT_NULL_MESSAGE(buffers[i], "Buffer is NULL\n");
+
+        uint32_t line = ((uintptr_t)buffers[i] % 4096) / 64;
+        if (!lineUsed[line])
+        {
+            lineUsed[line] = true;
+            linesUsed++;
+        }
+    }
+
+    // Find where each slab starts its buffers within the page
+    uintptr_t slabStarts[4];
+    uint32_t slabs = 1;
+    slabStarts[0] = (uintptr_t)buffers[0] % 4096;
+    for (uint32_t i = 1; i < 64 && slabs < 4; i++)
+    {
+        if ((uintptr_t)buffers[i] != (uintptr_t)buffers[i - 1] + ((uintptr_t)buffers[1] - (uintptr_t)buffers[0]))
+        {
+            slabStarts[slabs++] = (uintptr_t)buffers[i] % 4096;
+        }
+    }
+
+    TEST_ASSERT_EQUAL_MESSAGE(4, slabs, "Too few slabs\n");
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        for (uint32_t j = i + 1; j < 4; j++)
+        {
+            TEST_ASSERT_TRUE_MESSAGE(slabStarts[i] != slabStarts[j], "Slabs start in the same place\n");
+        }
+    }
+
+    // Between them the buffers should start in every cache line of a page
+    TEST_ASSERT_EQUAL_MESSAGE(64, linesUsed, "Buffers not spread over every cache set\n");
+
+    for (uint32_t i = 0; i < 64; i++)
+    {
+        com_wadsweb_bufferpool.free(buffers[i]);
+    }
+}
+
+void test_ColouredMultiPageItems(void)
+{
+    // Buffers spanning several pages should be an odd number of pages apart so their pages
+    // don't all fall in the same TLB sets
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createColoured("test_coloured_multi_page_items", 65536, 0, 0, 2);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+
+    void *first = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *second = com_wadsweb_bufferpool.alloc(bufferpool);
+    TEST_ASSERT_NOT_NULL_MESSAGE(first, "Buffer is NULL\n");
+    TEST_ASSERT_NOT_NULL_MESSAGE(second, "Buffer is NULL\n");
+
+    uintptr_t pages = ((uintptr_t)second - (uintptr_t)first) / 4096;
+    TEST_ASSERT_EQUAL_MESSAGE(1, pages % 2, "Buffers an even number of pages apart\n");
+
+    com_wadsweb_bufferpool.free(first);
+    com_wadsweb_bufferpool.free(second);
+}
+
+static void countRecoveredBuffer(void* buffer, void* context)
+{
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("in use", buffer, "Recovered buffer contents incorrect\n");
+    (*(uint32_t*)context)++;
+}
+
+void test_PersistentPoolReattach(void)
+{
+    tBufferPoolStats stats;
+    char *poolName = "test_persistent_pool";
+    char *path = "/tmp/test_persistent_pool.bin";
+    remove(path);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent(poolName, path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+
+    void *buffer1 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer2 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer3 = com_wadsweb_bufferpool.alloc(bufferpool);
+    strcpy(buffer1, "in use");
+    strcpy(buffer2, "released");
+    strcpy(buffer3, "in use");
+    com_wadsweb_bufferpool.free(buffer2);
+
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool.purgeFreeList(bufferpool), "Persistent pool purged\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+
+    bufferpool = com_wadsweb_bufferpool.createPersistent(poolName, path, 16, 4);
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not re-attached\n");
+    TEST_ASSERT_EQUAL_MESSAGE(16, stats.bufferSize, "Buffer size incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(4, stats.maxBuffers, "Max buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(1, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(3, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    uint32_t recovered = 0;
+    com_wadsweb_bufferpool.recoverBuffers(bufferpool, &countRecoveredBuffer, &recovered);
+
+    TEST_ASSERT_EQUAL_MESSAGE(2, recovered, "Recovered buffers incorrect\n");
+
+    // The free buffer is reused first, then the one remaining unused buffer, then we hit the limit
+    void *buffer4 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer5 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer6 = com_wadsweb_bufferpool.alloc(bufferpool);
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("released", buffer4, "Free buffer not reused\n");
+    TEST_ASSERT_NOT_NULL_MESSAGE(buffer5, "Buffer 5 is NULL\n");
+    TEST_ASSERT_NULL_MESSAGE(buffer6, "Buffer 6 is not NULL\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(4, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(1, stats.outOfBuffers, "Out of buffers incorrect\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    remove(path);
+}
+
+void test_PersistentPoolMismatch(void)
+{
+    char *path = "/tmp/test_persistent_pool_mismatch.bin";
+    remove(path);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_mismatch", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.createPersistent("test_persistent_pool_mismatch", path, 32, 4), "Pool attached with wrong buffer size\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.createPersistent("test_persistent_pool_mismatch", path, 16, 8), "Pool attached with wrong max buffers\n");
+
+    remove(path);
+}
+
+// Where fields live in a persistent pool file, mirroring tBufferPoolRegionHeader and tBufferPoolBufferItem
+#define REGION_ITEM_SIZE 16
+#define REGION_FIRST_ITEM_OFFSET 24
+#define REGION_FREE_HEAD_OFFSET 32
+#define REGION_FREE_BUFFERS 48
+#define REGION_HEADER_SIZE 64
+#define ITEM_UNIQUE 4
+#define ITEM_NEXT_OFFSET 16
+
+static uint64_t readPoolFile(const char *path, off_t offset)
+{
+    uint64_t value = 0;
+    int fd = open(path, O_RDONLY);
+    TEST_ASSERT_EQUAL_MESSAGE(sizeof(value), pread(fd, &value, sizeof(value), offset), "Pool file not read\n");
+    close(fd);
+    return value;
+}
+
+static void writePoolFile(const char *path, off_t offset, const void *value, size_t size)
+{
+    int fd = open(path, O_WRONLY);
+    TEST_ASSERT_EQUAL_MESSAGE(size, pwrite(fd, value, size, offset), "Pool file not written\n");
+    close(fd);
+}
+
+// Leaves a detached pool in the file with 3 buffers handed out. The free list is item 2 then item 0
+static void createPoolFile(const char *path)
+{
+    remove(path);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+
+    void *buffer1 = com_wadsweb_bufferpool.alloc(bufferpool);
+    com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer3 = com_wadsweb_bufferpool.alloc(bufferpool);
+    com_wadsweb_bufferpool.free(buffer1);
+    com_wadsweb_bufferpool.free(buffer3);
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+}
+
+static uint64_t poolFileItemOffset(const char *path, uint32_t index)
+{
+    return readPoolFile(path, REGION_FIRST_ITEM_OFFSET) + index * readPoolFile(path, REGION_ITEM_SIZE);
+}
+
+static void assertPoolFileRejected(const char *path, const char *message)
+{
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4), message);
+    remove(path);
+}
+
+void test_PersistentPoolIntactFile(void)
+{
+    char *path = "/tmp/test_persistent_pool_intact.bin";
+    createPoolFile(path);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Intact pool rejected\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    remove(path);
+}
+
+void test_PersistentPoolBadItemUnique(void)
+{
+    char *path = "/tmp/test_persistent_pool_bad_unique.bin";
+    createPoolFile(path);
+
+    uint32_t unique = readPoolFile(path, poolFileItemOffset(path, 1) + ITEM_UNIQUE) ^ 1;
+    writePoolFile(path, poolFileItemOffset(path, 1) + ITEM_UNIQUE, &unique, sizeof(unique));
+
+    assertPoolFileRejected(path, "Pool with a foreign item attached\n");
+}
+
+void test_PersistentPoolFreeLinkOutOfBounds(void)
+{
+    char *path = "/tmp/test_persistent_pool_out_of_bounds.bin";
+    createPoolFile(path);
+
+    // Item 3 exists in the file but has never been handed out
+    uint64_t offset = poolFileItemOffset(path, 3);
+    writePoolFile(path, REGION_FREE_HEAD_OFFSET, &offset, sizeof(offset));
+
+    assertPoolFileRejected(path, "Pool with a free link past the allocated items attached\n");
+}
+
+void test_PersistentPoolFreeLinkMisaligned(void)
+{
+    char *path = "/tmp/test_persistent_pool_misaligned.bin";
+    createPoolFile(path);
+
+    uint64_t offset = poolFileItemOffset(path, 0) + 8;
+    writePoolFile(path, poolFileItemOffset(path, 2) + ITEM_NEXT_OFFSET, &offset, sizeof(offset));
+
+    assertPoolFileRejected(path, "Pool with a misaligned free link attached\n");
+}
+
+void test_PersistentPoolFreeListLoop(void)
+{
+    char *path = "/tmp/test_persistent_pool_loop.bin";
+    createPoolFile(path);
+
+    uint64_t offset = poolFileItemOffset(path, 2);
+    writePoolFile(path, offset + ITEM_NEXT_OFFSET, &offset, sizeof(offset));
+
+    assertPoolFileRejected(path, "Pool with a free list loop attached\n");
+}
+
+static void assertPoolFileFreeCountRecovered(const char *path, uint32_t staleFreeBuffers)
+{
+    tBufferPoolStats stats;
+
+    createPoolFile(path);
+    writePoolFile(path, REGION_FREE_BUFFERS, &staleFreeBuffers, sizeof(staleFreeBuffers));
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Pool with a stale free count rejected\n");
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+    TEST_ASSERT_EQUAL_MESSAGE(2, stats.freeBuffers, "Free buffers not recounted\n");
+    TEST_ASSERT_EQUAL_MESSAGE(3, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    // Both free buffers should come back before a new one is handed out
+    TEST_ASSERT_NOT_NULL_MESSAGE(com_wadsweb_bufferpool.alloc(bufferpool), "Buffer is NULL\n");
+    TEST_ASSERT_NOT_NULL_MESSAGE(com_wadsweb_bufferpool.alloc(bufferpool), "Buffer is NULL\n");
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(3, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, (uint32_t)readPoolFile(path, REGION_FREE_BUFFERS), "Free count in file incorrect\n");
+    remove(path);
+}
+
+void test_PersistentPoolStaleFreeCount(void)
+{
+    // A process killed between updating the free list and its count leaves the count one out either way
+    char *path = "/tmp/test_persistent_pool_free_count.bin";
+
+    assertPoolFileFreeCountRecovered(path, 1);
+    assertPoolFileFreeCountRecovered(path, 3);
+}
+
+void test_PersistentPoolZeroedHeader(void)
+{
+    tBufferPoolStats stats;
+    char *path = "/tmp/test_persistent_pool_zeroed_header.bin";
+    uint8_t header[REGION_HEADER_SIZE];
+
+    // A crash after sizing the file but before writing the header leaves it zeroed
+    createPoolFile(path);
+    memset(header, 0, sizeof(header));
+    writePoolFile(path, 0, header, sizeof(header));
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4);
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Pool with a zeroed header not recreated\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.freeBuffers, "Free buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+    TEST_ASSERT_NOT_NULL_MESSAGE(com_wadsweb_bufferpool.alloc(bufferpool), "Buffer is NULL\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+
+    bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_file", path, 16, 4);
+    com_wadsweb_bufferpool.getStats(bufferpool, &stats);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Recreated pool not re-attached\n");
+    TEST_ASSERT_EQUAL_MESSAGE(1, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    remove(path);
+}
+
+void test_PersistentPoolAttachedTwice(void)
+{
+    char *path = "/tmp/test_persistent_pool_attached_twice.bin";
+    remove(path);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_attached_twice", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.createPersistent("test_persistent_pool_attached_twice", path, 16, 4), "Pool attached twice\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+
+    bufferpool = com_wadsweb_bufferpool.createPersistent("test_persistent_pool_attached_twice", path, 16, 4);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not re-attached after detach\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    remove(path);
+}
+
+void test_DetachHeapPool(void)
+{
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.create("test_detach_heap_pool", 8, 0, 0);
+
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Heap pool detached\n");
+}
+
+void test_ContiguousPoolIndices(void)
+{
+    tBufferPoolStats stats;
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.create("test_heap_pool_indices", 16, 0, 0);
+    tBufferPool *contiguous = com_wadsweb_bufferpool.createContiguous("test_contiguous_pool", 16, 4);
+
+    com_wadsweb_bufferpool.getStats(contiguous, &stats);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(contiguous, "Buffer pool not created\n");
+    TEST_ASSERT_EQUAL_MESSAGE(4, stats.maxBuffers, "Max buffers incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(0, stats.allocatedBuffers, "Allocated buffers incorrect\n");
+
+    void *buffer1 = com_wadsweb_bufferpool.alloc(contiguous);
+    void *buffer2 = com_wadsweb_bufferpool.alloc(contiguous);
+    void *heapBuffer = com_wadsweb_bufferpool.alloc(bufferpool);
+
+    TEST_ASSERT_EQUAL_MESSAGE(0, com_wadsweb_bufferpool.getBufferIndex(buffer1), "Buffer 1 index incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(1, com_wadsweb_bufferpool.getBufferIndex(buffer2), "Buffer 2 index incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(-1, com_wadsweb_bufferpool.getBufferIndex(heapBuffer), "Heap buffer has an index\n");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(buffer2, com_wadsweb_bufferpool.getBufferByIndex(contiguous, 1), "Buffer 2 not found by index\n");
+    TEST_ASSERT_NOT_NULL_MESSAGE(com_wadsweb_bufferpool.getBufferByIndex(contiguous, 3), "Unallocated buffer not found by index\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.getBufferByIndex(contiguous, 4), "Buffer found beyond the end of the pool\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool.getBufferByIndex(bufferpool, 0), "Buffer found by index in heap pool\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(contiguous), "Buffer pool not detached\n");
+}
+
 // Not really a test, just dumps all the stats to the console
 void test_DumpPools(void)
 {
@@ -0,0 +1,251 @@
+#define _DEFAULT_SOURCE // For syscall and the memory mapping functions
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "unity.h"
+#include "bufferpool.h"
+#include "bufferpool_uring.h"
+
+static int ringFd = -1;
+static struct io_uring_params params;
+
+void setUp(void)
+{
+    memset(&params, 0, sizeof(params));
+    ringFd = syscall(__NR_io_uring_setup, 4, &params);
+}
+
+void tearDown(void)
+{
+    if (ringFd >= 0)
+    {
+        close(ringFd);
+    }
+}
+
+// Just enough of an io_uring to submit one request at a time and wait for it to complete
+typedef struct
+{
+    uint32_t* sqTail;
+    uint32_t* sqMask;
+    uint32_t* sqArray;
+    struct io_uring_sqe* sqes;
+    uint32_t* cqHead;
+    uint32_t* cqMask;
+    struct io_uring_cqe* cqes;
+} tTestRing;
+
+static void mapRing(tTestRing* ring)
+{
+    uint8_t* sq = mmap(NULL, params.sq_off.array + params.sq_entries * sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+    uint8_t* cq = mmap(NULL, params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+
+    TEST_ASSERT_TRUE_MESSAGE(sq != MAP_FAILED && cq != MAP_FAILED && ring->sqes != MAP_FAILED, "Ring not mapped\n");
+
+    ring->sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->sqMask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (uint32_t*)(sq + params.sq_off.array);
+    ring->cqHead = (uint32_t*)(cq + params.cq_off.head);
+    ring->cqMask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+static void submitAndWait(tTestRing* ring, const struct io_uring_sqe* sqe, struct io_uring_cqe* cqe)
+{
+    uint32_t tail = *ring->sqTail;
+    uint32_t index = tail & *ring->sqMask;
+    ring->sqes[index] = *sqe;
+    ring->sqArray[index] = index;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    TEST_ASSERT_EQUAL_MESSAGE(1, syscall(__NR_io_uring_enter, ringFd, 1, 1, IORING_ENTER_GETEVENTS, NULL, 0), "Request not submitted\n");
+
+    uint32_t head = *ring->cqHead;
+    *cqe = ring->cqes[head & *ring->cqMask];
+    __atomic_store_n(ring->cqHead, head + 1, __ATOMIC_RELEASE);
+}
+
+void test_RegisterBuffers(void)
+{
+    if (ringFd < 0)
+    {
+        TEST_IGNORE_MESSAGE("io_uring not available\n");
+    }
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createContiguous("test_uring_register_buffers", 4096, 8);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Buffers not registered\n");
+
+    // The kernel only allows one set of fixed buffers at a time
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Buffers registered twice\n");
+    TEST_ASSERT_EQUAL_MESSAGE(EBUSY, errno, "Second registration error incorrect\n");
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.unregisterBuffers(ringFd), "Buffers not unregistered\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+}
+
+void test_RegisterTooManyBuffers(void)
+{
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createContiguous("test_uring_register_too_many", 64, 16385);
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufferpool, "Buffer pool not created\n");
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Too many buffers registered\n");
+    TEST_ASSERT_EQUAL_MESSAGE(EINVAL, errno, "Registration error incorrect\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+}
+
+void test_RegisterPersistentPool(void)
+{
+    if (ringFd < 0)
+    {
+        TEST_IGNORE_MESSAGE("io_uring not available\n");
+    }
+
+    // Only a file on tmpfs or hugetlbfs can back fixed buffers
+    char *path = "/dev/shm/test_uring_register_persistent_pool.bin";
+    remove(path);
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createPersistent("test_uring_register_persistent_pool", path, 4096, 8);
+    if (bufferpool == NULL)
+    {
+        TEST_IGNORE_MESSAGE("/dev/shm not available\n");
+    }
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Buffers not registered\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.unregisterBuffers(ringFd), "Buffers not unregistered\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    remove(path);
+}
+
+void test_RegisterHeapPool(void)
+{
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.create("test_uring_register_heap_pool", 4096, 8, 8);
+
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Heap pool registered\n");
+    TEST_ASSERT_EQUAL_MESSAGE(EINVAL, errno, "Registration error incorrect\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool_uring.createBufRing(bufferpool, ringFd, 0), "Buffer ring created for heap pool\n");
+}
+
+void test_BufRing(void)
+{
+    if (ringFd < 0)
+    {
+        TEST_IGNORE_MESSAGE("io_uring not available\n");
+    }
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createContiguous("test_uring_buf_ring", 4096, 8);
+    tBufferPool *otherpool = com_wadsweb_bufferpool.createContiguous("test_uring_buf_ring_other", 4096, 8);
+    tBufferPoolBufRing *bufRing = com_wadsweb_bufferpool_uring.createBufRing(bufferpool, ringFd, 7);
+
+    if (bufRing == NULL && errno == EINVAL)
+    {
+        TEST_IGNORE_MESSAGE("Provided buffer rings not supported by this kernel\n");
+    }
+
+    TEST_ASSERT_NOT_NULL_MESSAGE(bufRing, "Buffer ring not created\n");
+
+    void *buffer1 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *buffer2 = com_wadsweb_bufferpool.alloc(bufferpool);
+    void *otherBuffer = com_wadsweb_bufferpool.alloc(otherpool);
+
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, buffer1), "Buffer 1 not provided\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, buffer2), "Buffer 2 not provided\n");
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, buffer2), "Buffer 2 provided twice\n");
+    TEST_ASSERT_FALSE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, otherBuffer), "Buffer from another pool provided\n");
+
+    // The buffer ID in a completion is the buffer's index in the pool
+    uint32_t cqeFlags = IORING_CQE_F_BUFFER | (1 << IORING_CQE_BUFFER_SHIFT);
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(buffer2, com_wadsweb_bufferpool_uring.getSelectedBuffer(bufRing, cqeFlags), "Selected buffer incorrect\n");
+    TEST_ASSERT_NULL_MESSAGE(com_wadsweb_bufferpool_uring.getSelectedBuffer(bufRing, 0), "Buffer selected without a buffer flag\n");
+
+    // Once the kernel has handed it back it can be provided again
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, buffer2), "Returned buffer not provided again\n");
+
+    com_wadsweb_bufferpool_uring.destroyBufRing(bufRing);
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(otherpool), "Buffer pool not detached\n");
+}
+
+void test_FixedAndSelectedReads(void)
+{
+    if (ringFd < 0)
+    {
+        TEST_IGNORE_MESSAGE("io_uring not available\n");
+    }
+
+    char *path = "/tmp/test_uring_reads.txt";
+    char *contents = "read straight into pooled buffers";
+    FILE *file = fopen(path, "w");
+    fputs(contents, file);
+    fclose(file);
+    int fd = open(path, O_RDONLY);
+
+    tTestRing ring;
+    mapRing(&ring);
+
+    tBufferPool *bufferpool = com_wadsweb_bufferpool.createContiguous("test_uring_reads", 4096, 8);
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.registerBuffers(bufferpool, ringFd), "Buffers not registered\n");
+
+    // Read into a registered buffer straight from alloc
+    com_wadsweb_bufferpool.alloc(bufferpool);
+    void *fixedBuffer = com_wadsweb_bufferpool.calloc(bufferpool);
+
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ_FIXED;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)fixedBuffer;
+    sqe.len = 4096;
+    sqe.buf_index = com_wadsweb_bufferpool.getBufferIndex(fixedBuffer);
+    struct io_uring_cqe cqe;
+    submitAndWait(&ring, &sqe, &cqe);
+
+    TEST_ASSERT_EQUAL_MESSAGE(1, sqe.buf_index, "Buffer index incorrect\n");
+    TEST_ASSERT_EQUAL_MESSAGE(strlen(contents), cqe.res, "Fixed read length incorrect\n");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(contents, fixedBuffer, "Fixed read contents incorrect\n");
+
+    com_wadsweb_bufferpool.free(fixedBuffer);
+
+    // Let the kernel pick the buffer to read into
+    tBufferPoolBufRing *bufRing = com_wadsweb_bufferpool_uring.createBufRing(bufferpool, ringFd, 3);
+    if (bufRing == NULL && errno == EINVAL)
+    {
+        close(fd);
+        remove(path);
+        TEST_IGNORE_MESSAGE("Provided buffer rings not supported by this kernel\n");
+    }
+
+    void *providedBuffer = com_wadsweb_bufferpool.calloc(bufferpool);
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.provide(bufRing, providedBuffer), "Buffer not provided\n");
+
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_READ;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.fd = fd;
+    sqe.off = 5;
+    sqe.len = 4096;
+    sqe.buf_group = 3;
+    submitAndWait(&ring, &sqe, &cqe);
+
+    void *selectedBuffer = com_wadsweb_bufferpool_uring.getSelectedBuffer(bufRing, cqe.flags);
+
+    TEST_ASSERT_EQUAL_MESSAGE(strlen(contents) - 5, cqe.res, "Selected read length incorrect\n");
+    TEST_ASSERT_EQUAL_PTR_MESSAGE(providedBuffer, selectedBuffer, "Selected buffer incorrect\n");
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(contents + 5, selectedBuffer, "Selected read contents incorrect\n");
+
+    com_wadsweb_bufferpool.free(selectedBuffer);
+    com_wadsweb_bufferpool_uring.destroyBufRing(bufRing);
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool_uring.unregisterBuffers(ringFd), "Buffers not unregistered\n");
+    TEST_ASSERT_TRUE_MESSAGE(com_wadsweb_bufferpool.detach(bufferpool), "Buffer pool not detached\n");
+
+    close(fd);
+    remove(path);
+}